@@ -0,0 +1,97 @@
+#include "analysis.h"
+
+/* ===== ANALYSES OF A SINGLE RULE ===== */
+ruleAnalysis::ruleAnalysis( unsigned long long r, unsigned int s, unsigned int radius, unsigned int w ) : rule( r, s, radius ), width( w ) {
+
+    windows = windowModel::ipow( s, w );
+}
+
+// Run a pass on this rule alone
+void ruleAnalysis::require( const string& pass ){
+
+    vector<ruleAnalysis*> batch( 1, this );
+    analysisPipeline::require( batch, pass );
+}
+
+/* ===== ANALYSIS PIPELINE ===== */
+// Add a pass to the registry
+void addPass( map<string,analysisPass>& registry, const string& name, const vector<string>& needs, function<void( vector<ruleAnalysis*>& )> run ){
+
+    analysisPass& pass = registry[name];
+    pass.name = name;
+    pass.needs = needs;
+    pass.run = run;
+}
+
+// Build the registry of passes (once)
+const map<string,analysisPass>& analysisPipeline::passes(){
+
+    static map<string,analysisPass> registry;
+    static once_flag built;
+
+    call_once( built, [](){
+
+        // Normalized transition matrix (sparse only)
+        addPass( registry, "matrix", {}, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){
+                batch[i]->matrix = windowModel( &batch[i]->rule, batch[i]->width ).buildMatrix( false );
+            }
+        } );
+
+        // Dense form of the matrix, if small enough
+        addPass( registry, "dense", { "matrix" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){
+                if ( batch[i]->windows <= ruleAnalysis::denseLimit ){ batch[i]->matrix.toDense(); }
+            }
+        } );
+
+        // States accessible from each state
+        addPass( registry, "reachability", { "matrix" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){ batch[i]->matrix.getAccessLists(); }
+        } );
+
+        // Communicating classes
+        addPass( registry, "classes", { "matrix" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){ batch[i]->matrix.findCommClasses(); }
+        } );
+
+        // Closed cycles, searched only along edges that can return (from the access lists)
+        addPass( registry, "cycles", { "reachability" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){ batch[i]->matrix.findCycles(); }
+        } );
+
+        // Entropies, computed together for the whole batch
+        addPass( registry, "entropy", { "classes" }, []( vector<ruleAnalysis*>& batch ){
+            vector<transMatrix*> matrices;
+            for ( size_t i = 0; i < batch.size(); ++i ){ matrices.push_back( &batch[i]->matrix ); }
+            transMatrix::batchEntropy( matrices );
+        } );
+
+        // Long run powers of the dense matrix
+        addPass( registry, "powers", { "dense" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){ batch[i]->powers = batch[i]->matrix^ruleAnalysis::reps; }
+        } );
+
+        // Classification from the matrix and its powers
+        addPass( registry, "classification", { "powers" }, []( vector<ruleAnalysis*>& batch ){
+            for ( size_t i = 0; i < batch.size(); ++i ){ batch[i]->classification = batch[i]->matrix.classify( batch[i]->powers ); }
+        } );
+    } );
+
+    return registry;
+}
+
+// Run a pass on the rules of a batch that haven't had it
+void analysisPipeline::require( vector<ruleAnalysis*>& batch, const string& name ){
+
+    const analysisPass& pass = passes().at( name );
+
+    vector<ruleAnalysis*> todo;
+    for ( size_t i = 0; i < batch.size(); ++i ){ if ( !batch[i]->done.count( name ) ) todo.push_back( batch[i] ); }
+    if ( todo.empty() ){ return; }
+
+    for ( size_t i = 0; i < pass.needs.size(); ++i ){ require( todo, pass.needs[i] ); }
+
+    pass.run( todo );
+    for ( size_t i = 0; i < todo.size(); ++i ){ todo[i]->done.insert( name ); }
+}
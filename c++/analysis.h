@@ -0,0 +1,83 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+// STD Containers
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// Threading and pass functions
+#include <mutex>
+#include <functional>
+
+#include "transmatrix.h"
+#include "classes.h"
+
+// Name-spaces
+using namespace std;
+
+/* ===== ANALYSES OF A SINGLE RULE ===== */
+// Holds the transition matrix of a rule and the results of the analysis passes run on it
+class ruleAnalysis{
+
+    public:
+
+        /* CONSTRUCTOR */
+        ruleAnalysis( unsigned long long r, unsigned int s = 2, unsigned int radius = 1, unsigned int w = 3 );
+
+        /* CONTAINERS */
+        ruleset rule;
+        unsigned int width;
+        unsigned long long windows;
+
+        // Transition matrix (dense only after the dense pass, and if small enough) and its powers
+        transMatrix matrix, powers;
+
+        // Classification of the rule (0-3 for classes 1-4, -1 if unclassified)
+        int classification = -1;
+
+        // Names of the passes already run on this rule
+        set<string> done;
+
+        // Serializes use of this rule from several threads (not taken by the passes themselves)
+        mutex lock;
+
+        /* CONSTANTS */
+        // Largest number of windows for which the dense matrix is formed
+        static const unsigned long long denseLimit = 1024;
+
+        // Number of steps of the powers used for classification
+        static const int reps = 50;
+
+        /* METHODS */
+        // Run a pass (and the passes it needs) on this rule if it hasn't been already
+        void require( const string& pass );
+};
+
+/* ===== ANALYSIS PASS ===== */
+// Named step of the analysis, run on a batch of rules after the passes it needs
+class analysisPass{
+
+    public:
+
+        string name;
+        vector<string> needs;
+        function<void( vector<ruleAnalysis*>& )> run;
+};
+
+/* ===== ANALYSIS PIPELINE ===== */
+// Registry of the passes, each run lazily (and only once per rule) when a result needs it:
+// matrix -> reachability -> cycles, matrix -> classes -> entropy, matrix -> dense -> powers -> classification
+class analysisPipeline{
+
+    public:
+
+        // All the passes by name
+        static const map<string,analysisPass>& passes();
+
+        // Run a pass on the rules of a batch that haven't had it, after the passes it needs
+        static void require( vector<ruleAnalysis*>& batch, const string& name );
+};
+
+#endif // ANALYSIS_H
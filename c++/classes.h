@@ -4,38 +4,59 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <thread>
+#include <algorithm>
 
 using namespace Eigen;
 using namespace std;
 
-// Class that contains cellular automata ruleset, numbered according to Wolfram system (base 2)
+// Class that contains cellular automata ruleset, numbered according to Wolfram system (base states)
+// Rule maps a neighbourhood of 2*radius+1 cells to a new state, default is binary nearest neighbour
 class ruleset{
 
     public:
 
-        unsigned int value, n[8];
+        unsigned long long value;
+        unsigned int states = 2, radius = 1;
+        vector<unsigned int> n;
 
-        ruleset(){}
+        ruleset(){ n.resize(8,0); }
 
-        ruleset( unsigned int x ){ loadRules(x); }
+        ruleset( unsigned long long x, unsigned int s = 2, unsigned int r = 1 ) : states(s), radius(r) { loadRules(x); }
+
+        // Number of possible neighbourhoods (i.e. states^(2*radius+1))
+        unsigned long long neighbourhoods(){
+            unsigned long long size = 1;
+            for ( unsigned int i = 0; i < 2*radius+1; i++ ){ size *= states; }
+            return size;
+        }
 
         // Load appropriate states into array for a given int
-        void loadRules( unsigned int x ){
+        void loadRules( unsigned long long x ){
             value = x;
-            for ( int i = 0; i < 8; i++ ){
-                n[i] = (( x >> i ) & 1); // Sets value from digits of base 2 representation of x
+            n.resize( neighbourhoods() );
+            for ( unsigned long long i = 0; i < n.size(); i++ ){
+                n[i] = x % states;  // Sets value from digits of base (states) representation of x
+                x /= states;
             }
         }
 
+        // Load states directly from a table of updates (for rules too large to number)
+        void loadTable( const vector<unsigned int>& table ){
+            value = 0;
+            n = table;
+            n.resize( neighbourhoods(), 0 );
+        }
+
         // Print this ruleset
         void print(){
-            cout << "Ruleset " << value << endl;
-            for ( int i = 0; i < 8; i++ ){ cout << i << "(" << n[i] << ")"; }
+            cout << "Ruleset " << value << " (" << states << " states, radius " << radius << ")" << endl;
+            for ( unsigned long long i = 0; i < n.size(); i++ ){ cout << i << "(" << n[i] << ")"; }
             cout << endl;
         }
 
         // return value of state for given integer
-        unsigned int applyRule( unsigned int x ){ return n[x]; }
+        unsigned int applyRule( unsigned long long x ){ return n[x]; }
 };
 
 // Class for a permutation of states (3 wide, 2 states)
@@ -77,12 +98,105 @@ class permutation{
         }
 
         // Print the possible update permutations to a text file
-        void printUpdatesToFile( ofstream& aFile ){
+        void printUpdatesToFile( ostream& aFile ){
             aFile << updates[0] << "," << updates[1] << "," << updates[2] << "," << updates[3] << endl;
         }
 
 };
 
+// Class for windows of (width) adjacent cells under a ruleset of arbitrary states and radius
+// A window is numbered in base states with the left-most cell as the most significant digit.
+// Each window is extended by radius cells on either side, and the updates of these extended
+// windows give the possible next windows (the 3 wide binary case reproduces permutation)
+class windowModel{
+
+    public:
+
+        ruleset* rule;
+        unsigned int width;
+        unsigned long long windows, sideExtensions, extensions, hoodSize;
+
+        windowModel( ruleset* r, unsigned int w = 3 ) : rule(r), width(w) {
+            windows = ipow( rule->states, width );              // Number of window states S^w
+            sideExtensions = ipow( rule->states, rule->radius );  // Extensions to one side S^r
+            extensions = sideExtensions*sideExtensions;          // Neighbouring extensions S^2r
+            hoodSize = rule->neighbourhoods();
+        }
+
+        // Integer power
+        static unsigned long long ipow( unsigned long long b, unsigned int e ){
+            unsigned long long x = 1;
+            for ( unsigned int i = 0; i < e; i++ ){ x *= b; }
+            return x;
+        }
+
+        // Update of window x given the extension e (left cells e/S^r, right cells e%S^r)
+        unsigned long long update( unsigned long long x, unsigned long long e ){
+            unsigned long long ext = ( (e/sideExtensions)*windows + x )*sideExtensions + e%sideExtensions;
+            unsigned long long y = 0;
+            // Walk from the right-most cell, whose neighbourhood is the lowest digits of ext
+            for ( unsigned long long k = 0, place = 1; k < width; k++, place *= rule->states ){
+                y += rule->applyRule( ext % hoodSize )*place;
+                ext /= rule->states;
+            }
+            return y;
+        }
+
+        // Fill with the distinct possible updates of window x, and the number of extensions leading to each
+        void transitions( unsigned long long x, vector< pair<unsigned long long,unsigned long long> >& out ){
+            vector<unsigned long long> ups( extensions );
+            for ( unsigned long long e = 0; e < extensions; e++ ){ ups[e] = update( x, e ); }
+            sort( ups.begin(), ups.end() );
+            out.clear();
+            for ( unsigned long long e = 0; e < extensions; e++ ){
+                if ( out.empty() || out.back().first != ups[e] ){ out.push_back( make_pair( ups[e], 1ULL ) ); }
+                else{ ++out.back().second; }
+            }
+        }
+
+        // Collect the transitions of every numThreads'th window starting from window t
+        void countBlock( unsigned int t, unsigned int numThreads, vector< Triplet<float> >& block ){
+            vector< pair<unsigned long long,unsigned long long> > out;
+            for ( unsigned long long x = t; x < windows; x += numThreads ){
+                transitions( x, out );
+                for ( size_t j = 0; j < out.size(); j++ ){
+                    block.push_back( Triplet<float>( out[j].first, x, out[j].second ) );
+                }
+            }
+        }
+
+        // Build the (unnormalized) transition counts as a sparse matrix, column x holds updates of x
+        // Windows are split into blocks across threads, so the dense matrix is never formed
+        // Small models (fewer than 1024 windows per thread) are built on the calling thread
+        SparseMatrix<float> sparseCounts( unsigned int numThreads = 0 ){
+            if ( numThreads == 0 ){ numThreads = max( 1u, thread::hardware_concurrency() ); }
+            numThreads = (unsigned int)min<unsigned long long>( numThreads, windows/1024 + 1 );
 
+            vector< vector< Triplet<float> > > blocks( numThreads );
+            vector<thread> workers;
+
+            for ( unsigned int t = 1; t < numThreads; t++ ){
+                workers.push_back( thread( &windowModel::countBlock, this, t, numThreads, ref( blocks[t] ) ) );
+            }
+            countBlock( 0, numThreads, blocks[0] );
+            for ( size_t t = 0; t < workers.size(); t++ ){ workers[t].join(); }
+
+            vector< Triplet<float> > triplets;
+            for ( unsigned int t = 0; t < numThreads; t++ ){
+                triplets.insert( triplets.end(), blocks[t].begin(), blocks[t].end() );
+            }
+
+            SparseMatrix<float> counts( windows, windows );
+            counts.setFromTriplets( triplets.begin(), triplets.end() );
+            return counts;
+        }
+
+        // Build the normalized transition matrix of this model
+        transMatrix buildMatrix( bool dense = true, unsigned int numThreads = 0 ){
+            transMatrix matrix( sparseCounts( numThreads ), rule->states, width, dense );
+            matrix.normalize();
+            return matrix;
+        }
+};
 
 #endif // CLASSES_H_INCLUDED
@@ -1,7 +1,11 @@
 #include <iostream>
+#include <sstream>
+#include <deque>
 
 #include "transmatrix.h"
 #include "classes.h"    // All the classes are defined here
+#include "analysis.h"
+#include "server.h"
 
 using namespace std;
 
@@ -9,26 +13,11 @@ void printClass(){
 
     ruleset ruleA;
 
-    permutation permList[8];
-
     for ( int n = 0; n < 256; n++ ){
 
         ruleA.loadRules(n);
 
-        for ( int i = 0; i < 8; i++ ){
-            permList[i].setValue(i);
-            permList[i].setUpdates( &ruleA );
-        }
-
-        transMatrix testMatrix;
-
-        for ( int i = 0; i < 8; i++ ){
-            for ( int j = 0; j < 4; j++ ){
-                testMatrix( permList[i].updates[j], i ) += 1;
-            }
-        }
-
-        testMatrix.normalize();
+        transMatrix testMatrix = windowModel( &ruleA ).buildMatrix();
 
     }
 }
@@ -48,16 +37,9 @@ void printMatrix( int r ){
             permList[i].printUpdates();
         }
 
-        transMatrix testMatrix;
-
-        for ( int i = 0; i < 8; i++ ){
-            for ( int j = 0; j < 4; j++ ){
-                testMatrix(permList[i].updates[j],i) += 1;
-            }
-        }
+        transMatrix testMatrix = windowModel( &test ).buildMatrix();
         cout << endl;
 
-        testMatrix.normalize();
         testMatrix.printMatToConsole();
 
         testMatrix.printDegrees();
@@ -75,74 +57,157 @@ void printMatrix( int r ){
 
 }
 
-int printMatrixToFile( int r, ofstream& aFile, ofstream& bFile ){
+// Outputs of a sweep and the analysis passes each needs. Permutations, matrix, access and paths
+// are sections of the per rule files, entropy adds a section to these and columns to the stats,
+// stats and classes are the stats.txt and classes.txt files
+const map< string, vector<string> > sweepOutputs = {
+    { "permutations", {} },
+    { "matrix", { "dense" } },
+    { "access", { "reachability" } },
+    { "paths", { "cycles" } },
+    { "entropy", { "entropy" } },
+    { "stats", { "classification" } },
+    { "classes", { "classification" } }
+};
 
-        int reps = 50;
+// Print the selected sections of the analysis of a rule to its file
+void printMatrixToFile( ruleAnalysis& analysis, const set<string>& outputs, ofstream& aFile ){
 
-        aFile << "Rule: " << r << endl << endl;
+        transMatrix& testMatrix = analysis.matrix;
 
-        permutation permList[8];
+        aFile << "Rule: " << analysis.rule.value << endl << endl;
 
-        ruleset test(r);
+        if ( outputs.count( "permutations" ) ){
 
-        aFile << "Permutations" << endl;
+            permutation permList[8];
 
-        for ( int i = 0; i < 8; i++ ){
-            permList[i].setValue(i);
-            permList[i].setUpdates( &test );
-            permList[i].printUpdatesToFile( aFile );
-        }
+            aFile << "Permutations" << endl;
 
-        transMatrix testMatrix;
-
-        for ( int i = 0; i < 8; i++ ){
-            for ( int j = 0; j < 4; j++ ){
-                testMatrix( permList[i].updates[j], i ) += 1;
+            for ( int i = 0; i < 8; i++ ){
+                permList[i].setValue(i);
+                permList[i].setUpdates( &analysis.rule );
+                permList[i].printUpdatesToFile( aFile );
             }
-        }
 
-        aFile << endl;
+            aFile << endl;
+        }
 
-        testMatrix.normalize();
-        testMatrix.printMatToFile( aFile );
+        if ( outputs.count( "matrix" ) ){ testMatrix.printMatToFile( aFile ); }
         //testMatrix.printEigenValues( aFile );
 
-        testMatrix.printCommClasses( aFile );
-        aFile << endl;
+        if ( outputs.count( "access" ) ){
+            testMatrix.printCommClasses( aFile );
+            aFile << endl;
+        }
 
-        testMatrix.printPaths( aFile );
+        if ( outputs.count( "paths" ) ){ testMatrix.printPaths( aFile ); }
 
-        transMatrix powers = testMatrix^reps;
+        if ( outputs.count( "entropy" ) ){
+            aFile << "Topological entropy: " << testMatrix.topEntropy << endl;
+            aFile << "Entropy rate: " << testMatrix.entropyRate << endl << endl;
+        }
 
         //powers.printMatToFile( aFile );
+}
+
+// Print the stats line of a rule (with the entropy columns if selected)
+void printStatsToFile( ruleAnalysis& analysis, bool entropy, ofstream& bFile ){
 
-        bFile << r << ":\t" << testMatrix.onesOnDiagonal() << "\t" << testMatrix.onesOffDiagonal() << "\t" << powers.noZeros() << "\t" << powers.columnsMatch() << "\t" << powers.cellsMatch() << "\t" << powers.onesOnDiagonal()+powers.onesOffDiagonal();
+        transMatrix& testMatrix = analysis.matrix;
+        transMatrix& powers = analysis.powers;
 
-        if ( testMatrix.onesOnDiagonal() == 1 ){ bFile << "\t Class 1" << endl; return 0; }
-        else if ( powers.cellsMatch() ){ bFile << "\t Class 3" << endl; return 2; }
-        else if ( powers.noZeros() && powers.columnsMatch() ){ bFile << "\t Class 4" << endl; return 3; }
-        else if ( !powers.noZeros() ){ bFile << "\t Class 2" << endl; return 1; }
-        else{ bFile << endl; return -1; }
+        bFile << analysis.rule.value << ":\t" << testMatrix.onesOnDiagonal() << "\t" << testMatrix.onesOffDiagonal() << "\t" << powers.noZeros() << "\t" << powers.columnsMatch() << "\t" << powers.cellsMatch() << "\t" << powers.onesOnDiagonal()+powers.onesOffDiagonal();
+        if ( entropy ){ bFile << "\t" << testMatrix.topEntropy << "\t" << testMatrix.entropyRate; }
 
+        if ( analysis.classification >= 0 ){ bFile << "\t Class " << analysis.classification+1; }
+        bFile << endl;
 }
 
-int main(){
+// Run as a query server: --serve [socket path] [--threads n] [--cache n]
+int serve( int argc, char* argv[] ){
+
+    string path;
+    unsigned int numThreads = 0;
+    size_t cacheSize = 256;
+
+    try{
+        for ( int i = 2; i < argc; i++ ){
+            string arg = argv[i];
+            if ( arg == "--threads" && i+1 < argc ){ numThreads = stoul( argv[++i] ); }
+            else if ( arg == "--cache" && i+1 < argc ){ cacheSize = stoul( argv[++i] ); }
+            else if ( arg.compare( 0, 1, "-" ) == 0 ){ cerr << "Unknown or incomplete option: " << arg << endl; return 1; }
+            else if ( path.empty() ){ path = arg; }
+            else{ cerr << "Only one socket path can be given: " << arg << endl; return 1; }
+        }
+    }
+    catch ( exception& e ){ cerr << "Bad number for --threads or --cache" << endl; return 1; }
 
-    ofstream statFile;
-    statFile.open( "data/stats.txt" );
-    statFile << boolalpha;
-    statFile << "Rule \t 1's Dgl \t 1's Off \t No Zeros \t Column \t All" << endl;
+    queryServer server( numThreads, cacheSize );
 
-    vector<int> classes[4];
+    if ( !path.empty() ){ return server.serveSocket( path ); }
+    server.serve( cin, cout );
+    return 0;
+}
+
+// Sweep all rules: [--outputs permutations,matrix,access,paths,entropy,stats,classes] (default all)
+int main( int argc, char* argv[] ){
+
+    if ( argc > 1 && string( argv[1] ) == "--serve" ){ return serve( argc, argv ); }
+
+    set<string> outputs;
+
+    for ( int i = 1; i < argc; i++ ){
+        if ( string( argv[i] ) == "--outputs" && i+1 < argc ){
+            istringstream names( argv[++i] );
+            string name;
+            while ( getline( names, name, ',' ) ){
+                if ( !sweepOutputs.count( name ) ){ cerr << "Unknown output: " << name << endl; return 1; }
+                outputs.insert( name );
+            }
+        }
+    }
+    if ( outputs.empty() ){
+        for ( map< string, vector<string> >::const_iterator it = sweepOutputs.begin(); it != sweepOutputs.end(); ++it ){ outputs.insert( it->first ); }
+    }
 
+    // Analyses of every rule, only the passes needed by the outputs are run (each across the whole sweep)
+    deque<ruleAnalysis> rules;
+    vector<ruleAnalysis*> batch;
     for ( int i = 0; i< 256; i++ ){
-        ofstream file;
-        file.open ( "data/CA_Matrices"+to_string(i)+".txt" );
-        classes[printMatrixToFile( i, file, statFile )].push_back(i);
-        file.close();
+        rules.emplace_back( i );
+        batch.push_back( &rules.back() );
+    }
+    for ( set<string>::iterator it = outputs.begin(); it != outputs.end(); ++it ){
+        const vector<string>& needs = sweepOutputs.at( *it );
+        for ( size_t j = 0; j < needs.size(); ++j ){ analysisPipeline::require( batch, needs[j] ); }
+    }
+
+    bool entropy = outputs.count( "entropy" ) > 0;
+
+    if ( outputs.count( "permutations" ) || outputs.count( "matrix" ) || outputs.count( "access" ) || outputs.count( "paths" ) || entropy ){
+        for ( int i = 0; i< 256; i++ ){
+            ofstream file;
+            file.open ( "data/CA_Matrices"+to_string(i)+".txt" );
+            printMatrixToFile( rules[i], outputs, file );
+            file.close();
+        }
     }
 
-    statFile.close();
+    if ( outputs.count( "stats" ) ){
+        ofstream statFile;
+        statFile.open( "data/stats.txt" );
+        statFile << boolalpha;
+        statFile << "Rule \t 1's Dgl \t 1's Off \t No Zeros \t Column \t All" << ( entropy ? " \t Top Ent \t Ent Rate" : "" ) << endl;
+        for ( int i = 0; i< 256; i++ ){ printStatsToFile( rules[i], entropy, statFile ); }
+        statFile.close();
+    }
+
+    if ( !outputs.count( "classes" ) ){ return 0; }
+
+    vector<int> classes[4];
+    for ( int i = 0; i< 256; i++ ){
+        if ( rules[i].classification >= 0 ){ classes[rules[i].classification].push_back(i); }
+    }
 
     ofstream classFile;
     classFile.open( "data/classes.txt" );
@@ -0,0 +1,425 @@
+#include "server.h"
+
+// Chrono for timing replies
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+// Unix sockets
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* LIMITS */
+// Largest number of windows for a query, of window updates to build its matrix (windows*S^2r),
+// for the classification (dense powers) and for the search for cycles
+const unsigned long long maxWindows = 1ULL << 22;
+const unsigned long long maxUpdates = 1ULL << 16;
+const unsigned long long classLimit = 256;
+const unsigned long long cycleLimit = 64;
+
+// Pass needed by each analysis that can be queried
+const map<string,string> queryPasses = {
+    { "matrix", "matrix" },
+    { "reachability", "reachability" },
+    { "classes", "classes" },
+    { "cycles", "cycles" },
+    { "entropy", "entropy" },
+    { "class", "classification" }
+};
+
+// Escape a string for a JSON reply
+string jsonString( const string& s ){
+
+    string out = "\"";
+    for ( string::const_iterator it = s.begin(); it != s.end(); ++it ){
+        if ( *it == '"' || *it == '\\' ){ out += '\\'; }
+        if ( *it == '\n' ){ out += "\\n"; continue; }
+        out += *it;
+    }
+    return out + "\"";
+}
+
+// Write a number for a JSON reply (infinite values have no JSON representation)
+void jsonNumber( ostream& out, double x ){
+
+    if ( isfinite( x ) ){ out << x; }
+    else{ out << "null"; }
+}
+
+// Parse a count into an unsigned int, failing (rather than truncating) if it doesn't fit
+bool parseCount( const string& value, unsigned int& count ){
+
+    unsigned long long x = stoull( value );
+    if ( x > numeric_limits<unsigned int>::max() || value.find( '-' ) != string::npos ){ return false; }
+    count = x;
+    return true;
+}
+
+/* ===== RULE QUERY ===== */
+// Parse a query line of key=value pairs
+string ruleQuery::parse( const string& line ){
+
+    istringstream tokens( line );
+    string token;
+
+    try{
+        while ( tokens >> token ){
+
+            size_t split = token.find( '=' );
+            if ( split == string::npos ){ return "expected key=value, got " + token; }
+            string key = token.substr( 0, split ), value = token.substr( split+1 );
+
+            if ( key == "id" ){ id = value; }
+            else if ( key == "rule" ){
+                if ( value.find( '-' ) != string::npos ){ return "rule out of range"; }
+                rule = stoull( value );
+            }
+            else if ( key == "states" ){ if ( !parseCount( value, states ) ) return "states out of range"; }
+            else if ( key == "radius" ){ if ( !parseCount( value, radius ) ) return "radius out of range"; }
+            else if ( key == "width" ){ if ( !parseCount( value, width ) ) return "width out of range"; }
+            else if ( key == "analyses" ){
+                istringstream names( value );
+                string name;
+                while ( getline( names, name, ',' ) ){ if ( !name.empty() ) analyses.push_back( name ); }
+            }
+            else{ return "unknown key " + key; }
+        }
+    }
+    catch ( exception& e ){ return "bad value in " + token; }
+
+    if ( analyses.empty() ){ analyses.push_back( "entropy" ); analyses.push_back( "class" ); }
+
+    if ( states < 2 ){ return "states must be at least 2"; }
+    if ( width < 1 ){ return "width must be at least 1"; }
+
+    // Check the window count and rule number against their limits, stopping before overflow
+    unsigned long long windows = 1, rules = 1;
+    bool inRange = false;
+    for ( unsigned int i = 0; i < width; ++i ){
+        windows *= states;
+        if ( windows > maxWindows ){ return "too many windows (at most " + to_string( maxWindows ) + ")"; }
+    }
+    unsigned long long hoods = 1;
+    for ( unsigned long long i = 0; i < 2ULL*radius+1; ++i ){
+        if ( hoods > maxWindows/states ){ return "radius too large"; }
+        hoods *= states;
+    }
+    if ( windows*( hoods/states ) > maxUpdates ){ return "too much work (windows times extensions at most " + to_string( maxUpdates ) + ")"; }
+    for ( unsigned long long i = 0; i < hoods && !inRange; ++i ){
+        if ( rules > rule/states ){ inRange = true; }
+        rules *= states;
+    }
+    if ( !inRange && rule >= rules ){ return "rule out of range for states and radius"; }
+
+    for ( vector<string>::iterator it = analyses.begin(); it != analyses.end(); ++it ){
+        if ( !queryPasses.count( *it ) ){ return "unknown analysis " + *it; }
+        if ( *it == "class" && windows > classLimit ){
+            return *it + " is limited to " + to_string( classLimit ) + " windows";
+        }
+        if ( *it == "reachability" && windows > ruleAnalysis::denseLimit ){
+            return *it + " is limited to " + to_string( ruleAnalysis::denseLimit ) + " windows";
+        }
+        if ( *it == "cycles" && windows > cycleLimit ){
+            return *it + " is limited to " + to_string( cycleLimit ) + " windows";
+        }
+    }
+
+    return "";
+}
+
+// Key of this rule in the cache
+string ruleQuery::key() const {
+
+    return to_string( rule ) + ":" + to_string( states ) + ":" + to_string( radius ) + ":" + to_string( width );
+}
+
+/* ===== LEAST RECENTLY USED CACHE OF ANALYSES ===== */
+shared_ptr<ruleAnalysis> analysisCache::get( const ruleQuery& q, bool& hit ){
+
+    string key = q.key();
+    lock_guard<mutex> guard( lock );
+
+    map< string, list< pair< string, shared_ptr<ruleAnalysis> > >::iterator >::iterator found = index.find( key );
+    hit = ( found != index.end() );
+
+    // Move a hit to the front, otherwise add a new (empty) analysis at the front
+    if ( hit ){
+        entries.splice( entries.begin(), entries, found->second );
+        return entries.front().second;
+    }
+
+    shared_ptr<ruleAnalysis> analysis = make_shared<ruleAnalysis>( q.rule, q.states, q.radius, q.width );
+    entries.push_front( make_pair( key, analysis ) );
+    index[key] = entries.begin();
+    if ( entries.size() > capacity ){
+        index.erase( entries.back().first );
+        entries.pop_back();
+    }
+
+    // Returned even if a zero size cache evicted it straight away
+    return analysis;
+}
+
+/* ===== FIXED SIZE POOL OF WORKER THREADS ===== */
+threadPool::threadPool( unsigned int numThreads ){
+
+    if ( numThreads == 0 ){ numThreads = max( 1u, thread::hardware_concurrency() ); }
+    for ( unsigned int i = 0; i < numThreads; ++i ){ workers.push_back( thread( &threadPool::work, this ) ); }
+}
+
+threadPool::~threadPool(){
+
+    {
+        lock_guard<mutex> guard( lock );
+        stopping = true;
+    }
+    ready.notify_all();
+    for ( size_t i = 0; i < workers.size(); ++i ){ workers[i].join(); }
+}
+
+// Queue a task
+void threadPool::push( function<void()> task ){
+
+    {
+        lock_guard<mutex> guard( lock );
+        tasks.push( task );
+    }
+    ready.notify_one();
+}
+
+// Worker loop
+void threadPool::work(){
+
+    while ( true ){
+
+        function<void()> task;
+        {
+            unique_lock<mutex> guard( lock );
+            ready.wait( guard, [this](){ return stopping || !tasks.empty(); } );
+            if ( tasks.empty() ){ return; }
+            task = tasks.front();
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+/* ===== QUERY SERVER ===== */
+// Write the requested analyses as JSON fields
+void queryServer::writeFields( ruleAnalysis& analysis, const ruleQuery& q, ostream& out ){
+
+    lock_guard<mutex> guard( analysis.lock );
+    transMatrix& matrix = analysis.matrix;
+
+    for ( vector<string>::const_iterator it = q.analyses.begin(); it != q.analyses.end(); ++it ){
+
+        analysis.require( queryPasses.at( *it ) );
+
+        if ( *it == "entropy" ){
+            out << ",\"entropy\":{\"topological\":";
+            jsonNumber( out, matrix.topEntropy );
+            out << ",\"rate\":";
+            jsonNumber( out, matrix.entropyRate );
+            out << "}";
+        }
+        else if ( *it == "class" ){
+            out << ",\"class\":";
+            if ( analysis.classification >= 0 ){ out << analysis.classification+1; }
+            else{ out << "null"; }
+        }
+        else if ( *it == "classes" ){
+            out << ",\"classes\":[";
+            for ( size_t i = 0; i < matrix.commClasses.size(); ++i ){ out << ( i ? "," : "" ) << matrix.commClasses[i]; }
+            out << "]";
+        }
+        else if ( *it == "reachability" ){
+            out << ",\"reachability\":[";
+            for ( size_t i = 0; i < matrix.accessLists.size(); ++i ){
+                out << ( i ? ",[" : "[" );
+                for ( size_t j = 0; j < matrix.accessLists[i].size(); ++j ){ out << ( j ? "," : "" ) << matrix.accessLists[i][j]; }
+                out << "]";
+            }
+            out << "]";
+        }
+        else if ( *it == "cycles" ){
+            out << ",\"cycles\":[";
+            for ( size_t i = 0; i < matrix.cycles.size(); ++i ){
+                out << ( i ? ",[" : "[" );
+                for ( size_t j = 0; j < matrix.cycles[i].size(); ++j ){ out << ( j ? "," : "" ) << matrix.cycles[i][j]; }
+                out << "]";
+            }
+            out << "]";
+        }
+        else if ( *it == "matrix" ){
+            // Sparse entries as [to,from,probability]
+            out << ",\"matrix\":{\"size\":" << analysis.windows << ",\"entries\":[";
+            bool first = true;
+            for ( int i = 0; i < matrix.S.outerSize(); ++i ){
+                for ( SparseMatrix<float>::InnerIterator e( matrix.S, i ); e; ++e ){
+                    out << ( first ? "[" : ",[" ) << e.row() << "," << i << "," << e.value() << "]";
+                    first = false;
+                }
+            }
+            out << "]}";
+        }
+    }
+}
+
+// Answer a single query line with a one line JSON reply
+string queryServer::answer( const string& line, const string& defaultId ){
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    ruleQuery q;
+    q.id = defaultId;
+    string error = q.parse( line );
+
+    ostringstream reply;
+    reply.precision( 9 );
+    reply << "{\"id\":" << jsonString( q.id );
+
+    if ( !error.empty() ){
+        reply << ",\"error\":" << jsonString( error ) << "}";
+        return reply.str();
+    }
+
+    bool hit;
+    shared_ptr<ruleAnalysis> analysis = cache.get( q, hit );
+
+    reply << ",\"rule\":" << q.rule << ",\"states\":" << q.states << ",\"radius\":" << q.radius << ",\"width\":" << q.width;
+    reply << ",\"cached\":" << ( hit ? "true" : "false" );
+    writeFields( *analysis, q, reply );
+    reply << ",\"micros\":" << chrono::duration_cast<chrono::microseconds>( chrono::steady_clock::now() - start ).count() << "}";
+
+    return reply.str();
+}
+
+// Answer queries as they are read, replies are written (in the order they finish) before returning
+void queryServer::serveLines( function<bool(string&)> getLine, function<void(const string&)> putLine ){
+
+    mutex replyLock;
+    condition_variable finished;
+    int pending = 0;
+    unsigned long long count = 0;
+    string line;
+
+    while ( getLine( line ) ){
+
+        if ( line.find_first_not_of( " \t\r" ) == string::npos ){ continue; }
+        string id = to_string( ++count );
+
+        {
+            lock_guard<mutex> guard( replyLock );
+            ++pending;
+        }
+        pool.push( [this,line,id,&putLine,&replyLock,&finished,&pending](){
+            string reply = answer( line, id );
+            lock_guard<mutex> guard( replyLock );
+            putLine( reply );
+            if ( --pending == 0 ){ finished.notify_all(); }
+        } );
+    }
+
+    unique_lock<mutex> guard( replyLock );
+    finished.wait( guard, [&pending](){ return pending == 0; } );
+}
+
+// Answer queries from a stream
+void queryServer::serve( istream& in, ostream& out ){
+
+    serveLines( [&in]( string& line ){ return (bool)getline( in, line ); },
+                [&out]( const string& reply ){ out << reply << endl; } );
+}
+
+// Listen on a local Unix socket
+int queryServer::serveSocket( const string& path ){
+
+    sockaddr_un address = sockaddr_un();
+    if ( path.size() >= sizeof( address.sun_path ) ){ cerr << "Socket path too long: " << path << endl; return 1; }
+    address.sun_family = AF_UNIX;
+    path.copy( address.sun_path, path.size() );
+
+    // Only replace a stale socket, never any other kind of file
+    struct stat existing;
+    if ( lstat( path.c_str(), &existing ) == 0 && S_ISSOCK( existing.st_mode ) ){ unlink( path.c_str() ); }
+
+    int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( listener < 0 || ::bind( listener, (sockaddr*)&address, sizeof( address ) ) < 0 || listen( listener, 16 ) < 0 ){
+        cerr << "Could not listen on " << path << endl;
+        return 1;
+    }
+
+    // Open connections, each read on its own thread (the queries themselves run on the pool)
+    // Each closes its own socket when done, and finished ones are joined as new ones are accepted
+    struct socketConnection{ int fd; bool finished; thread reader; };
+    list<socketConnection> connections;
+    mutex connectionLock;
+
+    while ( true ){
+
+        int connection = accept( listener, NULL, NULL );
+        if ( connection < 0 ){ cerr << "Could not accept on " << path << endl; break; }
+
+        socketConnection* current;
+        {
+            lock_guard<mutex> guard( connectionLock );
+            for ( list<socketConnection>::iterator it = connections.begin(); it != connections.end(); ){
+                if ( !it->finished ){ ++it; continue; }
+                it->reader.join();
+                it = connections.erase( it );
+            }
+            connections.push_back( socketConnection() );
+            current = &connections.back();
+            current->fd = connection;
+            current->finished = false;
+        }
+
+        current->reader = thread( [this,connection,current,&connectionLock](){
+
+            string buffer;
+            char chunk[4096];
+
+            serveLines( [connection,&buffer,&chunk]( string& line ){
+                            size_t end;
+                            while ( ( end = buffer.find( '\n' ) ) == string::npos ){
+                                ssize_t got = read( connection, chunk, sizeof( chunk ) );
+                                if ( got <= 0 ){
+                                    if ( buffer.empty() ){ return false; }
+                                    line.swap( buffer );
+                                    buffer.clear();
+                                    return true;
+                                }
+                                buffer.append( chunk, got );
+                            }
+                            line = buffer.substr( 0, end );
+                            buffer.erase( 0, end+1 );
+                            return true;
+                        },
+                        [connection]( const string& reply ){
+                            string out = reply + "\n";
+                            for ( size_t sent = 0; sent < out.size(); ){
+                                ssize_t put = send( connection, out.data()+sent, out.size()-sent, MSG_NOSIGNAL );
+                                if ( put <= 0 ){ return; }
+                                sent += put;
+                            }
+                        } );
+
+            lock_guard<mutex> guard( connectionLock );
+            close( connection );
+            current->finished = true;
+        } );
+    }
+
+    // Stop reading the open connections, and wait for their queries to finish, before returning
+    close( listener );
+    {
+        lock_guard<mutex> guard( connectionLock );
+        for ( list<socketConnection>::iterator it = connections.begin(); it != connections.end(); ++it ){
+            if ( !it->finished ){ shutdown( it->fd, SHUT_RDWR ); }
+        }
+    }
+    for ( list<socketConnection>::iterator it = connections.begin(); it != connections.end(); ++it ){ it->reader.join(); }
+    return 1;
+}
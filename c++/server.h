@@ -0,0 +1,142 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// File and console streams
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// STD Containers
+#include <vector>
+#include <list>
+#include <map>
+#include <queue>
+#include <memory>
+
+// Threading
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "analysis.h"
+
+// Name-spaces
+using namespace std;
+
+/* ===== QUERY FOR A SINGLE RULE ===== */
+// A line of key=value pairs, e.g. "id=a rule=110 states=2 radius=1 width=3 analyses=entropy,class"
+// Any key can be left out to use its default
+class ruleQuery{
+
+    public:
+
+        /* CONTAINERS */
+        // Identifier echoed in the reply (replies can arrive out of order)
+        string id;
+
+        // Rule number (base states), number of states, rule radius and window width
+        unsigned long long rule = 0;
+        unsigned int states = 2, radius = 1, width = 3;
+
+        // Requested analyses (matrix, reachability, classes, cycles, entropy, class)
+        vector<string> analyses;
+
+        /* METHODS */
+        // Parse a query line, returns an error message (empty if the query is valid)
+        string parse( const string& line );
+
+        // Key of this rule in the cache
+        string key() const;
+};
+
+/* ===== LEAST RECENTLY USED CACHE OF ANALYSES ===== */
+class analysisCache{
+
+    public:
+
+        /* CONSTRUCTOR */
+        analysisCache( size_t size = 256 ) : capacity(size) {}
+
+        /* METHODS */
+        // Return the analysis for a query's rule, adding it (and evicting the least recently used) if missing
+        shared_ptr<ruleAnalysis> get( const ruleQuery& q, bool& hit );
+
+    private:
+
+        /* CONTAINERS */
+        size_t capacity;
+
+        // Entries, most recently used first, and their place in the list by key
+        list< pair< string, shared_ptr<ruleAnalysis> > > entries;
+        map< string, list< pair< string, shared_ptr<ruleAnalysis> > >::iterator > index;
+
+        mutex lock;
+};
+
+/* ===== FIXED SIZE POOL OF WORKER THREADS ===== */
+class threadPool{
+
+    public:
+
+        /* CONSTRUCTOR */
+        // Zero threads uses the hardware concurrency
+        threadPool( unsigned int numThreads = 0 );
+
+        // Finishes queued tasks then joins the workers
+        ~threadPool();
+
+        /* METHODS */
+        // Queue a task to be run by the next free worker
+        void push( function<void()> task );
+
+    private:
+
+        /* CONTAINERS */
+        vector<thread> workers;
+        queue< function<void()> > tasks;
+        mutex lock;
+        condition_variable ready;
+        bool stopping = false;
+
+        /* METHODS */
+        // Worker loop, runs tasks until stopped
+        void work();
+};
+
+/* ===== QUERY SERVER ===== */
+// Resident server answering rule queries from a stream or a local Unix socket
+// Each query line gets a one line JSON reply, written when its analyses are finished
+class queryServer{
+
+    public:
+
+        /* CONSTRUCTOR */
+        queryServer( unsigned int numThreads = 0, size_t cacheSize = 256 ) : cache(cacheSize), pool(numThreads) {}
+
+        /* METHODS */
+        // Answer a single query line, defaultId is used if the query doesn't give one
+        string answer( const string& line, const string& defaultId = "" );
+
+        // Answer queries from a stream until it ends
+        void serve( istream& in, ostream& out );
+
+        // Listen on a local Unix socket, each connection is served like a stream
+        // Returns only on error, once the open connections have been stopped and joined
+        int serveSocket( const string& path );
+
+    private:
+
+        /* CONTAINERS */
+        analysisCache cache;
+        threadPool pool;
+
+        /* METHODS */
+        // Write the requested analyses of a rule as JSON fields (running the passes they need)
+        void writeFields( ruleAnalysis& analysis, const ruleQuery& q, ostream& out );
+
+        // Answer queries read by getLine, handing replies to putLine, until there are no more
+        void serveLines( function<bool(string&)> getLine, function<void(const string&)> putLine );
+};
+
+#endif // SERVER_H
@@ -9,11 +9,21 @@ transMatrix::transMatrix( int dimensions ){
     accessLists.resize(dimensions,vector<int>());
 }
 
+// Constructor from sparse transition counts, only forms the dense matrix if asked
+transMatrix::transMatrix( const SparseMatrix<float>& counts, unsigned int s, unsigned int w, bool dense ){
+
+    S = counts;
+    states = s;
+    width = w;
+    accessLists.resize(S.rows(),vector<int>());
+    if ( dense ){ toDense(); }
+}
+
 /* OPERATOR OVERLOADS */
 // Matrix multiplication operator
 transMatrix transMatrix::operator* ( transMatrix& foo ){
 
-    transMatrix temp;
+    transMatrix temp( N.rows() );
     temp.N = this->N * foo.N;
     return temp;
 }
@@ -33,16 +43,18 @@ float& transMatrix::operator() ( int i, int j ){
 // Matrix exponentiation
 transMatrix transMatrix::operator^ ( int n ){
 
-    Matrix<float,Dynamic,Dynamic> tempA;
-    tempA.resize( N.rows(), N.cols() );
-    tempA = N;
+    // Multiplies by N n times (i.e. N^(n+1)), by repeated squaring
+    // Done in double, which can differ slightly from the old float step by step product
+    // (checked to give the same classification of the 256 binary rules)
+    Matrix<double,Dynamic,Dynamic> tempA = N.cast<double>(), square = tempA;
 
-    for ( int i = 0; i < n; ++i ){
-        tempA *= N;
+    for ( int e = n; e > 0; e >>= 1 ){
+        if ( e & 1 ){ tempA *= square; }
+        if ( e > 1 ){ square *= square; }
     }
 
-    transMatrix tempB;
-    tempB.N = tempA;
+    transMatrix tempB( N.rows() );
+    tempB.N = tempA.cast<float>();
     return tempB;
 }
 
@@ -50,7 +62,14 @@ transMatrix transMatrix::operator^ ( int n ){
 // Normalize the sum of row entries
 void transMatrix::normalize(){
 
-    N /= N.col(0).sum();
+    if ( S.nonZeros() > 0 ){ S /= S.col(0).sum(); }
+    if ( N.size() > 0 ){ N /= N.col(0).sum(); }
+}
+
+// Fill the dense matrix from the sparse matrix
+void transMatrix::toDense(){
+
+    N = Matrix<float,Dynamic,Dynamic>( S );
 }
 
 // Print the transmission matrix to console
@@ -68,7 +87,7 @@ void transMatrix::printMatToConsole(){
 }
 
 // Print the transmission matrix to a file
-void transMatrix::printMatToFile( ofstream& aFile ){
+void transMatrix::printMatToFile( ostream& aFile ){
 
     aFile << "Transmission matrix:" << endl;
 
@@ -142,55 +161,269 @@ bool transMatrix::cellsMatch(){
 }
 
 // Print eigenvalues of transmission matrix to file
-void transMatrix::printEigValToFile( ofstream& aFile ){
+void transMatrix::printEigValToFile( ostream& aFile ){
 
-    EigenSolver<Matrix<float,8,8>> solver;
+    EigenSolver<Matrix<float,Dynamic,Dynamic>> solver;
     solver.compute(N,false);
     aFile << "Eigenvalues: " << solver.eigenvalues().transpose() << endl << endl;
 }
 
-// Populate the access lists of each state
-void transMatrix::getAccessLists(){
+// Compute topological entropy and entropy rate for a batch of matrices
+// The matrices are stacked into block diagonal sparse matrices and power iteration is run on
+// all of them at once, each block is normalized and checked for convergence separately.
+// Topological entropy is the largest over the communicating classes, so each class is its own
+// (irreducible) block. The shifted matrices (A+I) and (P+I)/2 are iterated so periodic graphs
+// still converge, the stationary distribution is that reached from a uniform start. The chain is
+// only converged once the mass left on transient states (classes that can be left) is below tol,
+// and the rate is taken over the closed classes alone. Blocks that don't converge within maxIter
+// get NaN entropies and are reported on cerr
+void transMatrix::batchEntropy( vector<transMatrix*>& batch, int maxIter, double tol ){
+
+    int numMatrices = batch.size();
+
+    // Offsets of each matrix in the stacked chain, and of each class in the stacked adjacency
+    vector<int> offsets( 1, 0 ), classOffsets( 1, 0 ), classOwner;
+    vector< vector<int> > position( numMatrices );
+    vector< Triplet<double> > adjTriplets, probTriplets;
+
+    // Whether each state (in the stacked chain) is in a closed class
+    vector<bool> closed;
+
+    for ( int k = 0; k < numMatrices; ++k ){
+
+        SparseMatrix<float> P = batch[k]->S.cols() > 0 ? batch[k]->S : batch[k]->N.sparseView();
+        int n = P.cols();
+        offsets.push_back( offsets.back() + n );
+
+        if ( (int)batch[k]->commClasses.size() != n ){ batch[k]->findCommClasses(); }
+        vector<int>& label = batch[k]->commClasses;
+
+        // Order states by class, so each class is a contiguous block of the adjacency
+        vector<int> sizes( batch[k]->numClasses, 0 ), start( batch[k]->numClasses, 0 );
+        for ( int i = 0; i < n; ++i ){ ++sizes[label[i]]; }
+        for ( int c = 0; c < batch[k]->numClasses; ++c ){
+            start[c] = classOffsets.back();
+            classOffsets.push_back( classOffsets.back() + sizes[c] );
+            classOwner.push_back( k );
+        }
+        position[k].resize( n );
+        for ( int i = 0; i < n; ++i ){ position[k][i] = start[label[i]]++; }
 
-    // Push states accessible on first step from transmission matrix
-    for ( int i = 0; i < N.rows(); ++i ){
+        for ( int i = 0; i < P.outerSize(); ++i ){
 
-        for( int j = 0; j < N.cols(); ++j ){ if ( N(j,i) > 0 ) accessLists[i].push_back( j ); }
+            // Renormalize the column in double, float probabilities like k/9 don't sum to exactly 1
+            double columnSum = 0;
+            for ( SparseMatrix<float>::InnerIterator it( P, i ); it; ++it ){ if ( it.value() > 0 ) columnSum += it.value(); }
+
+            for ( SparseMatrix<float>::InnerIterator it( P, i ); it; ++it ){
+                if ( it.value() <= 0 ){ continue; }
+                if ( label[it.row()] == label[i] ){
+                    adjTriplets.push_back( Triplet<double>( position[k][it.row()], position[k][i], 1 ) );
+                }
+                probTriplets.push_back( Triplet<double>( offsets[k]+it.row(), offsets[k]+i, it.value()/columnSum ) );
+            }
+        }
+
+        // A class is closed if no transition leaves it
+        vector<bool> closedClass( batch[k]->numClasses, true );
+        for ( int i = 0; i < P.outerSize(); ++i ){
+            for ( SparseMatrix<float>::InnerIterator it( P, i ); it; ++it ){
+                if ( it.value() > 0 && label[it.row()] != label[i] ){ closedClass[label[i]] = false; }
+            }
+        }
+        for ( int i = 0; i < n; ++i ){ closed.push_back( closedClass[label[i]] ); }
     }
 
-    // Iterators
-    vector< vector<int> >::iterator sttIt;
-    vector<int>::iterator itA, itB;
+    int total = offsets.back(), numBlocks = classOwner.size();
+    for ( int i = 0; i < total; ++i ){
+        adjTriplets.push_back( Triplet<double>( i, i, 1 ) );
+        probTriplets.push_back( Triplet<double>( i, i, 1 ) );
+    }
 
-    // Loop over states
-    for ( sttIt = accessLists.begin(); sttIt != accessLists.end(); ++sttIt ){
+    SparseMatrix<double> A( total, total ), P( total, total );
+    A.setFromTriplets( adjTriplets.begin(), adjTriplets.end() );
+    P.setFromTriplets( probTriplets.begin(), probTriplets.end() );
+    P *= 0.5;
+
+    // Entropy of a single step out of each state, and indicator of states in closed classes
+    VectorXd stepEntropy = VectorXd::Zero( total ), closedMask( total );
+    for ( int i = 0; i < total; ++i ){ closedMask( i ) = closed[i] ? 1 : 0; }
+    for ( int i = 0; i < P.outerSize(); ++i ){
+        for ( SparseMatrix<double>::InnerIterator it( P, i ); it; ++it ){
+            double p = ( it.row() == i ? 2*it.value()-1 : 2*it.value() );
+            if ( p > 0 ){ stepEntropy( i ) -= p*log( p ); }
+        }
+    }
 
-        int vecLength; // Store vector length as check
+    // Start from uniform vectors in each block
+    VectorXd x( total ), pi( total );
+    for ( int c = 0; c < numBlocks; ++c ){
+        int n = classOffsets[c+1] - classOffsets[c];
+        x.segment( classOffsets[c], n ).setConstant( 1.0/n );
+    }
+    for ( int k = 0; k < numMatrices; ++k ){
+        int n = offsets[k+1] - offsets[k];
+        pi.segment( offsets[k], n ).setConstant( 1.0/n );
+    }
 
-        do{
-            vecLength = sttIt->size();
+    vector<double> growth( numBlocks, 0 );
+    vector<bool> classDone( numBlocks, false ), chainDone( numMatrices, false );
+    int remaining = numBlocks + numMatrices;
+
+    for ( int iter = 0; iter < maxIter && remaining > 0; ++iter ){
+
+        VectorXd y = A*x, q = P*pi;
+
+        // Growth of the 1-norm of a normalized positive vector approaches spectral radius of A+I
+        for ( int c = 0; c < numBlocks; ++c ){
+            if ( classDone[c] ){ continue; }
+            int n = classOffsets[c+1] - classOffsets[c];
+            growth[c] = y.segment( classOffsets[c], n ).sum();
+            double change = ( y.segment( classOffsets[c], n )/growth[c] - x.segment( classOffsets[c], n ) ).lpNorm<1>();
+            x.segment( classOffsets[c], n ) = y.segment( classOffsets[c], n )/growth[c];
+            if ( change < tol ){ classDone[c] = true; --remaining; }
+        }
+
+        // Distribution of the chain approaches the stationary distribution, with the transient mass going to zero
+        for ( int k = 0; k < numMatrices; ++k ){
+            if ( chainDone[k] ){ continue; }
+            int n = offsets[k+1] - offsets[k];
+            q.segment( offsets[k], n ) /= q.segment( offsets[k], n ).sum();
+            double change = ( q.segment( offsets[k], n ) - pi.segment( offsets[k], n ) ).lpNorm<1>();
+            pi.segment( offsets[k], n ) = q.segment( offsets[k], n );
+            double transient = 1 - pi.segment( offsets[k], n ).dot( closedMask.segment( offsets[k], n ) );
+            if ( change < tol && transient < tol ){ chainDone[k] = true; --remaining; }
+        }
+    }
+
+    const double undefined = numeric_limits<double>::quiet_NaN();
+    int failed = 0;
+
+    // Rate over the closed classes only, so no transient mass is counted
+    for ( int k = 0; k < numMatrices; ++k ){
+        int n = offsets[k+1] - offsets[k];
+        VectorXd limit = pi.segment( offsets[k], n ).cwiseProduct( closedMask.segment( offsets[k], n ) );
+        batch[k]->entropyRate = chainDone[k] ? limit.dot( stepEntropy.segment( offsets[k], n ) )/limit.sum() : undefined;
+        batch[k]->topEntropy = -numeric_limits<double>::infinity();
+        if ( !chainDone[k] ){ ++failed; }
+    }
+    for ( int c = 0; c < numBlocks; ++c ){
+        transMatrix* owner = batch[classOwner[c]];
+        if ( !classDone[c] ){ owner->topEntropy = undefined; ++failed; }
+        else if ( !std::isnan( owner->topEntropy ) ){ owner->topEntropy = max( owner->topEntropy, log( growth[c] - 1 ) ); }
+    }
+
+    if ( failed > 0 ){
+        cerr << "Entropy: " << failed << " of " << numMatrices+numBlocks << " blocks did not converge in " << maxIter << " iterations" << endl;
+    }
+}
+
+// Label the communicating classes with Tarjan's algorithm (iterative, so large graphs don't overflow the stack)
+void transMatrix::findCommClasses(){
+
+    SparseMatrix<float> P = S.cols() > 0 ? S : N.sparseView();
+    int n = P.cols();
+
+    vector<int> index( n, -1 ), low( n, 0 ), stack;
+    vector<bool> onStack( n, false );
+    vector< pair<int,SparseMatrix<float>::InnerIterator> > calls;
+    int counter = 0;
+
+    commClasses.assign( n, -1 );
+    numClasses = 0;
+
+    for ( int root = 0; root < n; ++root ){
 
-            vector<int> append;
+        if ( index[root] >= 0 ){ continue; }
 
-            for ( itA = sttIt->begin(); itA != sttIt->end(); ++itA ){
+        index[root] = low[root] = counter++;
+        stack.push_back( root );
+        onStack[root] = true;
+        calls.push_back( make_pair( root, SparseMatrix<float>::InnerIterator( P, root ) ) );
 
-                for ( itB = accessLists[*itA].begin(); itB != accessLists[*itA].end(); ++itB ){
+        while ( !calls.empty() ){
 
-                    append.push_back( *itB );
+            int v = calls.back().first;
+            SparseMatrix<float>::InnerIterator& it = calls.back().second;
+
+            // Skip to the next unvisited child, updating low links of visited ones
+            while ( it && ( it.value() <= 0 || index[it.row()] >= 0 ) ){
+                if ( it.value() > 0 && onStack[it.row()] ){ low[v] = min( low[v], index[it.row()] ); }
+                ++it;
+            }
+
+            if ( it ){
+                int w = it.row();
+                ++it;
+                index[w] = low[w] = counter++;
+                stack.push_back( w );
+                onStack[w] = true;
+                calls.push_back( make_pair( w, SparseMatrix<float>::InnerIterator( P, w ) ) );
+                continue;
+            }
+
+            // All children done, pop a class if this is its root
+            if ( low[v] == index[v] ){
+                int w;
+                do{
+                    w = stack.back();
+                    stack.pop_back();
+                    onStack[w] = false;
+                    commClasses[w] = numClasses;
                 }
+                while( w != v );
+                ++numClasses;
+            }
+
+            calls.pop_back();
+            if ( !calls.empty() ){
+                int u = calls.back().first;
+                low[u] = min( low[u], low[v] );
+            }
+        }
+    }
+}
+
+// Populate the one step successors and access lists of each state
+// Each access list is found by a breadth first search from the successors of the state
+void transMatrix::getAccessLists(){
+
+    SparseMatrix<float> P = S.cols() > 0 ? S : N.sparseView();
+    int n = P.cols();
+
+    // Push states accessible on first step from transmission matrix
+    successors.assign( n, vector<int>() );
+    for ( int i = 0; i < n; ++i ){
+        for ( SparseMatrix<float>::InnerIterator it( P, i ); it; ++it ){ if ( it.value() > 0 ) successors[i].push_back( it.row() ); }
+    }
+
+    accessLists.assign( n, vector<int>() );
+    vector<int> seen( n, -1 );
+    vector<int>::iterator itA, itB;
+
+    // Loop over states
+    for ( int i = 0; i < n; ++i ){
+
+        vector<int>& access = accessLists[i];
+
+        for ( itA = successors[i].begin(); itA != successors[i].end(); ++itA ){
+            if ( seen[*itA] != i ){ seen[*itA] = i; access.push_back( *itA ); }
+        }
+
+        // Access list doubles as the search queue
+        for ( size_t head = 0; head < access.size(); ++head ){
+            for ( itB = successors[access[head]].begin(); itB != successors[access[head]].end(); ++itB ){
+                if ( seen[*itB] != i ){ seen[*itB] = i; access.push_back( *itB ); }
             }
-            sttIt->insert( sttIt->end(), append.begin(), append.end() );
-            sort( sttIt->begin(), sttIt->end() );
-            sttIt->erase( unique( sttIt->begin(), sttIt->end() ), sttIt->end() );
         }
-        while( sttIt->size() != vecLength );
+        sort( access.begin(), access.end() );
     }
 }
 
 // Print the communication classes of this transmission matrix
-void transMatrix::printCommClasses(  ofstream& aFile ){
+void transMatrix::printCommClasses(  ostream& aFile ){
 
-    if ( accessLists.front().empty() ) getAccessLists();
+    if ( successors.empty() ) getAccessLists();
 
     aFile << "State accesibility:" << endl;
 
@@ -211,18 +444,23 @@ void transMatrix::printCommClasses(  ofstream& aFile ){
     aFile << endl;
 }
 
-// Print the closed cycles of thee transmission graph of this matrix
-void transMatrix::printPaths( ofstream& aFile ){
+// Find the closed cycles of the transmission graph of this matrix
+void transMatrix::findCycles(){
+
+    if ( successors.empty() ) getAccessLists();
+
+    int numStates = successors.size();
 
     // States as nodes
-    node nodeList[8];
+    vector<node> nodeList( numStates );
 
-    // Populate nodes from
-    for ( int i = 0; i < 8; ++i ){
+    // Populate nodes from the successors, only keeping those that can get back (i.e. could be on a cycle)
+    for ( int i = 0; i < numStates; ++i ){
         nodeList[i].value = i;
-        for ( int j = 0; j < 8; ++j ){
-            if ( N(j,i) > 0 ){
-                    nodeList[i].addChild( nodeList+j ); }
+        nodeList[i].localVisit.resize( numStates, false );
+        for ( vector<int>::iterator it = successors[i].begin(); it != successors[i].end(); ++it ){
+            if ( binary_search( accessLists[*it].begin(), accessLists[*it].end(), i ) ){
+                    nodeList[i].addChild( &nodeList[*it] ); }
         }
     }
 
@@ -232,7 +470,7 @@ void transMatrix::printPaths( ofstream& aFile ){
     list< list<node*> >::iterator listIt;
     list<node*>::iterator nodeIt;
 
-    for ( int i = 0; i < 8; ++i ){
+    for ( int i = 0; i < numStates; ++i ){
 
         // Push first node to the current stack
         nodeList[i].visited = true;
@@ -318,30 +556,62 @@ void transMatrix::printPaths( ofstream& aFile ){
     paths.sort();
     paths.unique();
 
+    // Store the cycles as state values
+    cycles.clear();
+    for ( listIt = paths.begin(); listIt != paths.end(); ++listIt ){
+        cycles.push_back( vector<int>() );
+        for ( nodeIt = listIt->begin(); nodeIt != listIt->end(); ++nodeIt ){ cycles.back().push_back( (*nodeIt)->value ); }
+    }
+}
+
+// Print the closed cycles of thee transmission graph of this matrix
+void transMatrix::printPaths( ostream& aFile ){
+
+    if ( cycles.empty() ) findCycles();
+
     // Print the node relationship list
     aFile << "Nodes:" << endl;
-    for ( int i = 0; i < 8; ++i ){ nodeList[i].printNode(aFile); }
+    for ( size_t i = 0; i < successors.size(); ++i ){
+        aFile << i << "-> ";
+        for ( vector<int>::iterator it = successors[i].begin(); it != successors[i].end(); ++it ){ aFile << *it << ","; }
+        aFile << endl;
+    }
     aFile << endl;
 
     // Print the cycles and their state representation
     aFile << "Cycles: "<< endl;
-    for ( listIt = paths.begin(); listIt != paths.end(); ++listIt ){
-        for ( nodeIt = listIt->begin(); nodeIt != listIt->end(); ++nodeIt ){
-            if ( next(nodeIt) == listIt->end() ){ aFile << (*nodeIt)->value; }
-            else{ aFile << (*nodeIt)->value << "->"; }
+    vector< vector<int> >::iterator cycIt;
+    vector<int>::iterator sttIt;
+    for ( cycIt = cycles.begin(); cycIt != cycles.end(); ++cycIt ){
+        for ( sttIt = cycIt->begin(); sttIt != cycIt->end(); ++sttIt ){
+            if ( next(sttIt) == cycIt->end() ){ aFile << *sttIt; }
+            else{ aFile << *sttIt << "->"; }
         }
         aFile << endl;
 
-        list<node*>::reverse_iterator disIt;
-        for ( disIt = listIt->rbegin(); disIt != listIt->rend(); ++disIt ){
-            for ( int i = 2; i > -1; --i ){
-                if ( ( (*disIt)->value >> i ) % 2 == 0 ){ aFile << "\u2591"; }
-                else{ aFile << "\u2588"; }
+        vector<int>::reverse_iterator disIt;
+        for ( disIt = cycIt->rbegin(); disIt != cycIt->rend(); ++disIt ){
+            int place = 1;
+            for ( unsigned int i = 1; i < width; ++i ){ place *= states; }
+            for ( ; place > 0; place /= states ){
+                int cell = ( *disIt / place ) % states;
+                if ( states == 2 ){ aFile << ( cell == 0 ? "\u2591" : "\u2588" ); }
+                else{ aFile << cell; }
             }
             aFile << endl;
         }
     }
-    aFile << endl << "Number of cycles: " << paths.size() << endl;
+    aFile << endl << "Number of cycles: " << cycles.size() << endl;
+
+
+}
 
+// Classify from this matrix and its powers, returns 0-3 for classes 1-4 (-1 if unclassified)
+int transMatrix::classify( transMatrix& powers ){
 
+    if ( onesOnDiagonal() == 1 ){ return 0; }
+    else if ( powers.cellsMatch() ){ return 2; }
+    else if ( powers.noZeros() && powers.columnsMatch() ){ return 3; }
+    else if ( !powers.noZeros() ){ return 1; }
+    else{ return -1; }
 }
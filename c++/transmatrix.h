@@ -9,6 +9,7 @@
 #include <Core>
 #include <Dense>
 #include <Eigenvalues>
+#include <Sparse>
 
 // STD Containers
 #include <vector>
@@ -37,17 +38,17 @@ class node{
         bool visited = false;
 
         // Store whether children have been visited from this state
-        array<bool,8> localVisit = {{false,false,false,false,false,false,false,false}};
+        vector<bool> localVisit;
 
         /* METHODS */
         // Add a child reference to this node
         void addChild( node* child ){ children.push_back( child ); }
 
         // Mark all the children of this state as unvisited
-        void clearVisits(){ for( int i = 0; i < 8; ++i ){ localVisit[i] = false; } }
+        void clearVisits(){ fill( localVisit.begin(), localVisit.end(), false ); }
 
         // Print the value and children of this node
-        void printNode( ofstream& aFile ){
+        void printNode( ostream& aFile ){
             aFile << value << "-> ";
             for ( list<node*>::iterator it = children.begin(); it != children.end(); ++it ){
                 aFile << (*it)->value << ",";
@@ -69,16 +70,36 @@ class transMatrix{
         // and resizes containers appropriately
         transMatrix( int dimensions = 8 );
 
+        // Construct from sparse transition counts (e.g. from windowModel::sparseCounts)
+        // The dense matrix is only filled if requested, so wide windows can stay sparse
+        transMatrix( const SparseMatrix<float>& counts, unsigned int s, unsigned int w, bool dense = true );
+
         /* CONTAINERS */
         // Matrix of transmission probabilities
         Matrix<float,Dynamic,Dynamic> N;
 
-        // Stores vectors of access lists from each state
-        vector< vector<int> > accessLists;
+        // Sparse matrix of transmission probabilities (empty unless built from counts)
+        SparseMatrix<float> S;
+
+        // Number of cell states and window width, used to display states
+        unsigned int states = 2, width = 3;
+
+        // Topological entropy (log spectral radius of adjacency) and entropy rate of the chain
+        // Natural logs, only set by batchEntropy
+        double topEntropy = 0, entropyRate = 0;
 
-        // Vector to contain communicating class
+        // Stores vectors of states accessible in one step, and access lists, from each state
+        vector< vector<int> > successors, accessLists;
+
+        // Vector to contain communicating class of each state
         vector<int> commClasses;
 
+        // Number of communicating classes
+        int numClasses = 0;
+
+        // Closed cycles of the transmission graph, as lists of states
+        vector< vector<int> > cycles;
+
         /* OPERATOR OVERLOADS */
         // Matrix multiplication
         transMatrix operator* ( transMatrix& foo );
@@ -93,11 +114,14 @@ class transMatrix{
         // Normalize the sum of row entries
         void normalize();
 
+        // Fill the dense matrix from the sparse matrix
+        void toDense();
+
         // Print the transmission matrix to console
         void printMatToConsole();
 
         // Print the matrix to a file
-        void printMatToFile( ofstream& aFile );
+        void printMatToFile( ostream& aFile );
 
         // Return sum of values of column
         float sumOfColumn( int n ){ return N.row(n).sum(); }
@@ -124,16 +148,28 @@ class transMatrix{
         bool cellsMatch();
 
         // Print the eigenvalues of this matrix
-        void printEigValToFile( ofstream& aFile );
+        void printEigValToFile( ostream& aFile );
+
+        // Compute the entropies of a batch of matrices together, iterating on one block diagonal matrix
+        static void batchEntropy( vector<transMatrix*>& batch, int maxIter = 20000, double tol = 1e-9 );
 
-        // Populate the access lists
+        // Populate the successors and access lists
         void getAccessLists();
 
+        // Label the communicating class of each state (strongly connected components of the graph)
+        void findCommClasses();
+
         // Find the communicating classes of this transmission matrix
-        void printCommClasses( ofstream& aFile );
+        void printCommClasses( ostream& aFile );
+
+        // Find the closed cycle paths of this markov chain
+        void findCycles();
 
         // Print the closed cycle paths of this markov chain
-        void printPaths( ofstream& aFile );
+        void printPaths( ostream& aFile );
+
+        // Classify from this matrix and its powers (0-3 for classes 1-4, -1 if unclassified)
+        int classify( transMatrix& powers );
 };
 
 #endif // TRANSMATRIX_H